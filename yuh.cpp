@@ -6,6 +6,41 @@
 #include <memory>
 #include <vector>
 #include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdlib>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iomanip>
+#include <list>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <random>
+#include <span>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 // Interface-like abstract class (pure virtual class in C++)
 #include <fstream>
@@ -50,6 +85,62 @@ public:
     virtual ~AbstractCalculator() = default;
 };
 
+// Numeric result of a calculation: the value, or the reason there is none.
+// Turning it into text is left to format:: at output time.
+enum class CalcError : std::uint8_t { None, DivisionByZero, NotANumber, Infinite, Overflow, UnknownOperation };
+
+struct CalcResult {
+    double value;
+    CalcError error;
+
+    constexpr bool ok() const { return error == CalcError::None; }
+};
+
+// Output formatting shared by the REPL and the batch front end. std::to_chars
+// writes the shortest text that parses back to the same double, without the
+// locale lookups and rounding to 6 digits of printf/iostream.
+namespace format {
+
+// Enough for any double in shortest round-trip form, e.g. -2.2250738585072014e-308
+constexpr std::size_t kMaxDoubleChars = 32;
+
+inline std::string_view errorMessage(CalcError error) {
+    switch (error) {
+        case CalcError::DivisionByZero: return "Error: Cannot divide by zero";
+        case CalcError::NotANumber: return "Error: NaN values are not allowed";
+        case CalcError::Infinite: return "Error: Infinite values are not allowed";
+        case CalcError::Overflow: return "Error: Result is infinite";
+        case CalcError::UnknownOperation: return "Error: Unknown operation";
+        case CalcError::None: break;
+    }
+    return "";
+}
+
+// Writes into `out`, which must hold kMaxDoubleChars; returns the end
+inline char* toChars(char* out, double value) {
+    return std::to_chars(out, out + kMaxDoubleChars, value).ptr;
+}
+
+inline void append(std::string& out, double value) {
+    char buffer[kMaxDoubleChars];
+    out.append(buffer, toChars(buffer, value));
+}
+
+inline void append(std::string& out, const CalcResult& result) {
+    if (result.ok()) {
+        append(out, result.value);
+    } else {
+        out.append(errorMessage(result.error));
+    }
+}
+
+inline std::ostream& write(std::ostream& os, double value) {
+    char buffer[kMaxDoubleChars];
+    return os.write(buffer, toChars(buffer, value) - buffer);
+}
+
+} // namespace format
+
 // Main Calculator class implementing inheritance
 class Calculator : public AbstractCalculator, public MathOperations {
 private:
@@ -106,92 +197,56 @@ public:
         return result;
     }
 
-    std::string divide(double a, double b) {
+    CalcResult divide(double a, double b) {
         if (b == 0) {
-            return "Error: Cannot divide by zero";
+            return {0.0, CalcError::DivisionByZero};
         }
         result = a / b;
         operationName = "Division";
         operationsPerformed++;
-        return std::to_string(result);
+        return {result, CalcError::None};
     }
-};
-
-void printMenu() {
-    std::cout << "\nCalculator Menu:" << std::endl;
-    std::cout << "1. Add" << std::endl;
-    std::cout << "2. Subtract" << std::endl;
-    std::cout << "3. Multiply" << std::endl;
-    std::cout << "4. Divide" << std::endl;
-    std::cout << "5. Exit" << std::endl;
-}
-
-int main() {
-    Calculator calc;
-    std::string choice;
-    double num1, num2;
-
-    while (true) {
-        try {
-            printMenu();
-            std::cout << "Enter your choice (1-5): ";
-            std::getline(std::cin, choice);
 
-            if (choice == "5") {
-                std::cout << "Goodbye!" << std::endl;
-                break;
-            }
+    // Batch versions (defined with the kernels in section 15). Each call
+    // covers whole arrays; result, operationName and operationsPerformed are
+    // updated once per batch instead of once per element.
+    void addBatch(std::span<const double> a, std::span<const double> b, std::span<double> out);
+    void subtractBatch(std::span<const double> a, std::span<const double> b, std::span<double> out);
+    void multiplyBatch(std::span<const double> a, std::span<const double> b, std::span<double> out);
+    // Zero divisors give NaN in their lane and are not counted; returns how many there were
+    std::size_t divideBatch(std::span<const double> a, std::span<const double> b, std::span<double> out);
 
-            if (choice != "1" && choice != "2" && choice != "3" && choice != "4") {
-                throw std::invalid_argument("Invalid choice. Please enter 1-5.");
-            }
+protected:
+    // `last` is empty when the final lane failed; like the scalar versions,
+    // a failed operation leaves result unchanged
+    void recordBatch(const char* name, std::optional<double> last, std::size_t count);
+};
 
-            std::cout << "Enter first number: ";
-            if (!(std::cin >> num1)) {
-                std::cin.clear();
-                std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-                throw std::invalid_argument("Invalid input for first number");
-            }
-            
-            std::cout << "Enter second number: ";
-            if (!(std::cin >> num2)) {
-                std::cin.clear();
-                std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-                throw std::invalid_argument("Invalid input for second number");
-            }
-            std::cin.ignore();
+// The expression REPL is defined with its compiler in section 16, the
+// streaming batch mode in section 19 and the parallel one in section 20
+int runCalculatorRepl();
+int runCalculatorBatch(const char* path);  // nullptr or "-" reads stdin
+int runParallelBatch(const char* path, std::size_t threadCount);
 
-            if (choice == "1") {
-                std::cout << "Result: " << calc.add(num1, num2) << std::endl;
-            }
-            else if (choice == "2") {
-                std::cout << "Result: " << calc.subtract(num1, num2) << std::endl;
-            }
-            else if (choice == "3") {
-                std::cout << "Result: " << calc.multiply(num1, num2) << std::endl;
-            }
-            else if (choice == "4") {
-                if (num2 == 0) {
-                    throw std::runtime_error("Division by zero is not allowed");
-                }
-                std::cout << "Result: " << calc.divide(num1, num2) << std::endl;
+int main(int argc, char* argv[]) {
+    if (argc > 1 && std::string_view(argv[1]) == "--batch") {
+        const char* path = argc > 2 ? argv[2] : nullptr;
+        // calculator --batch <file> --threads N
+        if (argc > 4 && std::string_view(argv[3]) == "--threads" && path && std::string_view(path) != "-") {
+            constexpr std::size_t kMaxThreads = 256;
+            std::string_view arg(argv[4]);
+            std::size_t threads = 0;
+            auto [end, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), threads);
+            if (ec != std::errc() || end != arg.data() + arg.size() || threads == 0) {
+                std::cerr << "Usage: calculator --batch <file> --threads N (N is a positive integer)"
+                          << std::endl;
+                return 1;
             }
+            return runParallelBatch(path, std::min(threads, kMaxThreads));
         }
-        catch (const std::invalid_argument& e) {
-            std::cerr << "Input Error: " << e.what() << std::endl;
-        }
-        catch (const std::runtime_error& e) {
-            std::cerr << "Runtime Error: " << e.what() << std::endl;
-        }
-        catch (const std::exception& e) {
-            std::cerr << "Error: " << e.what() << std::endl;
-        }
-        catch (...) {
-            std::cerr << "Unknown error occurred" << std::endl;
-        }
+        return runCalculatorBatch(path);
     }
-
-    return 0;
+    return runCalculatorRepl();
 }
 
 /*
@@ -343,6 +398,48 @@ public:
         }
         return result;
     }
+
+    // Non-throwing versions of the checks above, for data where bad inputs
+    // are common: the failure comes back as an error code (see section 21)
+    CalcError checkInputs(double a, double b) const noexcept {
+        if (std::isnan(a) || std::isnan(b)) {
+            return CalcError::NotANumber;
+        }
+        if (std::isinf(a) || std::isinf(b)) {
+            return CalcError::Infinite;
+        }
+        return CalcError::None;
+    }
+
+    CalcResult tryAdd(double a, double b) noexcept {
+        if (CalcError error = checkInputs(a, b); error != CalcError::None) {
+            return {0.0, error};
+        }
+        return {add(a, b), CalcError::None};
+    }
+
+    CalcResult tryDivide(double a, double b) const noexcept {
+        if (CalcError error = checkInputs(a, b); error != CalcError::None) {
+            return {0.0, error};
+        }
+        if (b == 0.0) {
+            return {0.0, CalcError::DivisionByZero};
+        }
+
+        double result = a / b;
+        if (std::isinf(result)) {
+            return {0.0, CalcError::Overflow};
+        }
+        return {result, CalcError::None};
+    }
+
+    // Batch versions (section 22): one SIMD pass marks the invalid lanes, so
+    // clean data runs the plain batch kernels. Failed lanes get NaN in `out`
+    // and their code in `errors` (which may be left empty); returns how many failed.
+    std::size_t tryAddBatch(std::span<const double> a, std::span<const double> b,
+                            std::span<double> out, std::span<CalcError> errors = {});
+    std::size_t tryDivideBatch(std::span<const double> a, std::span<const double> b,
+                               std::span<double> out, std::span<CalcError> errors = {}) const;
 };
 
 // 7. RESOURCE MANAGEMENT WITH EXCEPTIONS (RAII):
@@ -552,40 +649,2036 @@ void demonstrateStackUnwinding() {
 }
 
 // 14. ERROR HANDLING UTILITY FUNCTIONS:
-template<typename T>
+// Holds either a value or a small error code, in the same storage. Failures
+// carry no std::string: errorMessage() looks up static text only when it is
+// asked for, so producing, passing and checking results never allocates.
+template<typename T, typename E = CalcError>
 class Result {
-private:
-    bool success_;
-    T value_;
-    std::string error_;
+    static_assert(std::is_trivially_copyable_v<E>, "error codes should be small, plain values");
 
 public:
-    Result(T value) : success_(true), value_(std::move(value)) {}
-    Result(std::string error) : success_(false), error_(std::move(error)) {}
-    
-    bool isSuccess() const { return success_; }
-    const T& getValue() const { 
+    Result(T value) : value_(std::move(value)), success_(true) {}
+    Result(E error) : error_(error), success_(false) {}
+
+    Result(const Result& other) { constructFrom(other); }
+    Result(Result&& other) noexcept(std::is_nothrow_move_constructible_v<T>) { constructFrom(std::move(other)); }
+
+    // Assignment destroys the old value before building the new one in its
+    // place, so a throwing move would leave success_ naming a dead T. It is
+    // only offered for types whose move cannot throw; the copy is made first,
+    // so a throwing copy leaves *this untouched.
+    Result& operator=(const Result& other) requires std::is_nothrow_move_constructible_v<T> {
+        if (this != &other) {
+            Result copy(other);
+            destroy();
+            constructFrom(std::move(copy));
+        }
+        return *this;
+    }
+
+    Result& operator=(Result&& other) noexcept requires std::is_nothrow_move_constructible_v<T> {
+        if (this != &other) {
+            destroy();
+            constructFrom(std::move(other));
+        }
+        return *this;
+    }
+
+    ~Result() { destroy(); }
+
+    bool isSuccess() const noexcept { return success_; }
+    explicit operator bool() const noexcept { return success_; }
+
+    const T& getValue() const {
         if (!success_) throw std::runtime_error("No value in error result");
-        return value_; 
+        return value_;
+    }
+    T valueOr(T fallback) const { return success_ ? value_ : std::move(fallback); }
+
+    // Only meaningful when !isSuccess()
+    E getError() const noexcept { return error_; }
+    // Rendered on demand; only instantiated for error types format:: knows
+    std::string_view errorMessage() const { return success_ ? std::string_view() : format::errorMessage(error_); }
+
+    // f(value) returns another Result with the same error type; the first
+    // failure in a chain is passed through unchanged
+    template<typename F>
+    auto and_then(F&& f) const {
+        using Next = std::invoke_result_t<F, const T&>;
+        if (success_) {
+            return std::invoke(std::forward<F>(f), value_);
+        }
+        return Next(error_);
+    }
+
+    // f(value) returns a plain value, which is wrapped in a Result
+    template<typename F>
+    auto transform(F&& f) const -> Result<std::invoke_result_t<F, const T&>, E> {
+        if (success_) {
+            return std::invoke(std::forward<F>(f), value_);
+        }
+        return error_;
+    }
+
+private:
+    union {
+        T value_;
+        E error_;
+    };
+    bool success_;
+
+    template<typename Other>
+    void constructFrom(Other&& other) {
+        if (other.success_) {
+            new (&value_) T(std::forward<Other>(other).value_);
+        } else {
+            new (&error_) E(other.error_);
+        }
+        success_ = other.success_;
+    }
+
+    void destroy() noexcept {
+        if (success_) {
+            value_.~T();
+        }
     }
-    const std::string& getError() const { return error_; }
 };
 
-Result<double> safeCalculation(double a, double b, char op) {
-    try {
+// A double and a one-byte code: 16 bytes, the same as std::optional<double>
+static_assert(sizeof(Result<double>) == 16);
+
+Result<double> safeCalculation(double a, double b, char op) noexcept {
+    switch (op) {
+        case '+': return a + b;
+        case '-': return a - b;
+        case '*': return a * b;
+        case '/':
+            if (b == 0) return CalcError::DivisionByZero;
+            return a / b;
+        default:
+            return CalcError::UnknownOperation;
+    }
+}
+
+// (a / b + c) * 2 for every row of a batch; a failed step skips the rest of
+// its chain, and failures are only counted here, never formatted
+std::size_t evaluateRatios(std::span<const double> a, std::span<const double> b,
+                           std::span<const double> c, std::span<double> out) noexcept {
+    std::size_t failures = 0;
+    for (std::size_t i = 0; i < a.size(); ++i) {
+        Result<double> row = safeCalculation(a[i], b[i], '/')
+            .and_then([&](double ratio) { return safeCalculation(ratio, c[i], '+'); })
+            .transform([](double sum) { return sum * 2; });
+        out[i] = row.valueOr(std::numeric_limits<double>::quiet_NaN());
+        failures += !row;
+    }
+    return failures;
+}
+
+// 15. VECTORIZED BATCH OPERATIONS:
+// Each kernel handles a whole array per call. Every instruction set gets its
+// own function compiled with a target attribute, so one binary runs on any
+// x86-64 CPU and uses the widest kernel the machine supports.
+namespace batch {
+
+enum class Op { Add, Subtract, Multiply, Divide };
+enum class Isa { Scalar, Avx2, Avx512 };
+
+// Returns the number of zero divisors (always 0 for the other operations)
+using Kernel = std::size_t (*)(const double* a, const double* b, double* out, std::size_t n);
+
+template<Op op>
+std::size_t scalarKernel(const double* a, const double* b, double* out, std::size_t n) {
+    std::size_t zeroDivisors = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+        if constexpr (op == Op::Add) {
+            out[i] = a[i] + b[i];
+        } else if constexpr (op == Op::Subtract) {
+            out[i] = a[i] - b[i];
+        } else if constexpr (op == Op::Multiply) {
+            out[i] = a[i] * b[i];
+        } else {
+            // Zero divisors yield NaN instead of an error string
+            zeroDivisors += (b[i] == 0.0);
+            out[i] = b[i] == 0.0 ? std::numeric_limits<double>::quiet_NaN() : a[i] / b[i];
+        }
+    }
+    return zeroDivisors;
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CALCULATOR_HAS_X86_KERNELS 1
+
+template<Op op>
+__attribute__((target("avx2")))
+std::size_t avx2Kernel(const double* a, const double* b, double* out, std::size_t n) {
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d nan = _mm256_set1_pd(std::numeric_limits<double>::quiet_NaN());
+    std::size_t zeroDivisors = 0;
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = _mm256_loadu_pd(a + i);
+        __m256d y = _mm256_loadu_pd(b + i);
+        __m256d r;
+        if constexpr (op == Op::Add) {
+            r = _mm256_add_pd(x, y);
+        } else if constexpr (op == Op::Subtract) {
+            r = _mm256_sub_pd(x, y);
+        } else if constexpr (op == Op::Multiply) {
+            r = _mm256_mul_pd(x, y);
+        } else {
+            __m256d isZero = _mm256_cmp_pd(y, zero, _CMP_EQ_OQ);
+            r = _mm256_blendv_pd(_mm256_div_pd(x, y), nan, isZero);
+            zeroDivisors += __builtin_popcount(_mm256_movemask_pd(isZero));
+        }
+        _mm256_storeu_pd(out + i, r);
+    }
+    // Fewer than 4 elements left
+    return zeroDivisors + scalarKernel<op>(a + i, b + i, out + i, n - i);
+}
+
+template<Op op>
+__attribute__((target("avx512f")))
+std::size_t avx512Kernel(const double* a, const double* b, double* out, std::size_t n) {
+    const __m512d zero = _mm512_setzero_pd();
+    const __m512d nan = _mm512_set1_pd(std::numeric_limits<double>::quiet_NaN());
+    std::size_t zeroDivisors = 0;
+    for (std::size_t i = 0; i < n; i += 8) {
+        // The tail is handled by masked loads and stores instead of a scalar loop
+        __mmask8 lanes = n - i >= 8 ? __mmask8(0xFF) : __mmask8((1u << (n - i)) - 1);
+        __m512d x = _mm512_maskz_loadu_pd(lanes, a + i);
+        __m512d y = _mm512_maskz_loadu_pd(lanes, b + i);
+        __m512d r;
+        if constexpr (op == Op::Add) {
+            r = _mm512_add_pd(x, y);
+        } else if constexpr (op == Op::Subtract) {
+            r = _mm512_sub_pd(x, y);
+        } else if constexpr (op == Op::Multiply) {
+            r = _mm512_mul_pd(x, y);
+        } else {
+            __mmask8 isZero = _mm512_mask_cmp_pd_mask(lanes, y, zero, _CMP_EQ_OQ);
+            r = _mm512_mask_blend_pd(isZero, _mm512_div_pd(x, y), nan);
+            zeroDivisors += __builtin_popcount(isZero);
+        }
+        _mm512_mask_storeu_pd(out + i, lanes, r);
+    }
+    return zeroDivisors;
+}
+#endif
+
+inline Isa detectIsa() {
+#ifdef CALCULATOR_HAS_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return Isa::Avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return Isa::Avx2;
+    }
+#endif
+    return Isa::Scalar;
+}
+
+// Detected once; the batch methods never re-check CPU features
+inline Isa activeIsa() {
+    static const Isa isa = detectIsa();
+    return isa;
+}
+
+inline const char* isaName(Isa isa) {
+    switch (isa) {
+        case Isa::Avx512: return "AVX-512";
+        case Isa::Avx2: return "AVX2";
+        case Isa::Scalar: return "scalar";
+    }
+    return "unknown";
+}
+
+template<Op op>
+Kernel kernelFor(Isa isa) {
+#ifdef CALCULATOR_HAS_X86_KERNELS
+    if (isa == Isa::Avx512) {
+        return avx512Kernel<op>;
+    }
+    if (isa == Isa::Avx2) {
+        return avx2Kernel<op>;
+    }
+#endif
+    (void)isa;
+    return scalarKernel<op>;
+}
+
+template<Op op>
+std::size_t run(std::span<const double> a, std::span<const double> b, std::span<double> out) {
+    if (a.size() != b.size() || out.size() < a.size()) {
+        throw std::invalid_argument("Batch inputs must have equal length and fit in the output");
+    }
+    static const Kernel kernel = kernelFor<op>(activeIsa());
+    return kernel(a.data(), b.data(), out.data(), a.size());
+}
+
+} // namespace batch
+
+void Calculator::recordBatch(const char* name, std::optional<double> last, std::size_t count) {
+    if (count == 0) {
+        return;
+    }
+    if (last) {
+        result = *last;
+    }
+    operationName = name;
+    operationsPerformed += static_cast<int>(count);
+}
+
+void Calculator::addBatch(std::span<const double> a, std::span<const double> b, std::span<double> out) {
+    batch::run<batch::Op::Add>(a, b, out);
+    recordBatch("Addition", a.empty() ? std::nullopt : std::optional(out[a.size() - 1]), a.size());
+}
+
+void Calculator::subtractBatch(std::span<const double> a, std::span<const double> b, std::span<double> out) {
+    batch::run<batch::Op::Subtract>(a, b, out);
+    recordBatch("Subtraction", a.empty() ? std::nullopt : std::optional(out[a.size() - 1]), a.size());
+}
+
+void Calculator::multiplyBatch(std::span<const double> a, std::span<const double> b, std::span<double> out) {
+    batch::run<batch::Op::Multiply>(a, b, out);
+    recordBatch("Multiplication", a.empty() ? std::nullopt : std::optional(out[a.size() - 1]), a.size());
+}
+
+std::size_t Calculator::divideBatch(std::span<const double> a, std::span<const double> b, std::span<double> out) {
+    std::size_t zeroDivisors = batch::run<batch::Op::Divide>(a, b, out);
+    // Like divide(), a zero divisor is not a performed operation and leaves result alone
+    bool lastSucceeded = !a.empty() && b[a.size() - 1] != 0.0;
+    recordBatch("Division", lastSucceeded ? std::optional(out[a.size() - 1]) : std::nullopt,
+                a.size() - zeroDivisors);
+    return zeroDivisors;
+}
+
+// Throughput of every kernel the CPU supports, plus the per-element
+// Calculator::add loop for comparison. GB/s counts both inputs and the
+// output (24 bytes per element). The small size stays in cache; the large
+// one is bound by memory bandwidth.
+void benchmarkBatchOperations() {
+    using Clock = std::chrono::steady_clock;
+
+    auto gigabytesPerSecond = [](std::size_t n, int repeats, Clock::duration elapsed) {
+        double bytes = 3.0 * sizeof(double) * n * repeats;
+        return bytes / std::chrono::duration<double>(elapsed).count() / 1e9;
+    };
+
+    std::vector<batch::Isa> isas{batch::Isa::Scalar};
+    if (batch::activeIsa() != batch::Isa::Scalar) {
+        isas.push_back(batch::Isa::Avx2);
+    }
+    if (batch::activeIsa() == batch::Isa::Avx512) {
+        isas.push_back(batch::Isa::Avx512);
+    }
+
+    for (std::size_t n : {std::size_t(4096), std::size_t(1) << 22}) {
+        int repeats = static_cast<int>((std::size_t(1) << 28) / n);
+        std::vector<double> a(n), b(n), out(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            a[i] = 1.0 + static_cast<double>(i % 97);
+            b[i] = 1.0 + static_cast<double>(i % 89);
+        }
+
+        std::cout << std::fixed << std::setprecision(2);
+        std::cout << "\n" << n << " elements, " << repeats << " repeats (GB/s)" << std::endl;
+        std::cout << std::left << std::setw(8) << "kernel" << std::right;
+        for (const char* op : {"add", "subtract", "multiply", "divide"}) {
+            std::cout << std::setw(9) << op;
+        }
+        std::cout << std::endl;
+
+        Calculator calc;
+        auto start = Clock::now();
+        for (int r = 0; r < repeats; ++r) {
+            for (std::size_t i = 0; i < n; ++i) {
+                out[i] = calc.add(a[i], b[i]);
+            }
+        }
+        std::cout << std::left << std::setw(8) << "per-call" << std::right
+                  << std::setw(9) << gigabytesPerSecond(n, repeats, Clock::now() - start) << std::endl;
+
+        for (batch::Isa isa : isas) {
+            batch::Kernel kernels[] = {
+                batch::kernelFor<batch::Op::Add>(isa),
+                batch::kernelFor<batch::Op::Subtract>(isa),
+                batch::kernelFor<batch::Op::Multiply>(isa),
+                batch::kernelFor<batch::Op::Divide>(isa),
+            };
+            std::cout << std::left << std::setw(8) << batch::isaName(isa) << std::right;
+            for (batch::Kernel kernel : kernels) {
+                start = Clock::now();
+                for (int r = 0; r < repeats; ++r) {
+                    kernel(a.data(), b.data(), out.data(), n);
+                }
+                std::cout << std::setw(9) << gigabytesPerSecond(n, repeats, Clock::now() - start);
+            }
+            std::cout << std::endl;
+        }
+    }
+}
+
+// 16. EXPRESSION COMPILER AND BYTECODE VM:
+// Expressions such as "3*x^2 + sqrt(y) - 1" are parsed once into a flat
+// program for a small stack machine. A CompiledExpression only runs the
+// interpreter loop, so one formula can be evaluated over millions of inputs
+// without being parsed again.
+//
+// Grammar, lowest precedence first (^ is right-associative, so -x^2 is -(x^2)):
+//   expression := term (('+' | '-') term)*
+//   term       := unary (('*' | '/' | '%') unary)*
+//   unary      := ('-' | '+') unary | power
+//   power      := primary ('^' unary)?
+//   primary    := number | name | name '(' arguments ')' | '(' expression ')'
+namespace expr {
+
+enum class OpCode : std::uint8_t {
+    Const,   // push constants[operand]
+    Load,    // push variable slot `operand`
+    Add, Subtract, Multiply, Divide, Modulo, Power,
+    Negate,
+    Call1,   // unaryFunctions[operand] applied to the top of the stack
+    Call2,   // binaryFunctions[operand] applied to the top two values
+};
+
+struct Instruction {
+    OpCode op;
+    std::uint32_t operand;
+};
+
+struct UnaryFunction {
+    std::string_view name;
+    double (*fn)(double);
+};
+
+struct BinaryFunction {
+    std::string_view name;
+    double (*fn)(double, double);
+};
+
+inline const UnaryFunction unaryFunctions[] = {
+    {"sqrt", [](double x) { return std::sqrt(x); }},
+    {"abs", [](double x) { return std::fabs(x); }},
+    {"exp", [](double x) { return std::exp(x); }},
+    {"log", [](double x) { return std::log(x); }},
+    {"sin", [](double x) { return std::sin(x); }},
+    {"cos", [](double x) { return std::cos(x); }},
+    {"tan", [](double x) { return std::tan(x); }},
+    {"floor", [](double x) { return std::floor(x); }},
+    {"ceil", [](double x) { return std::ceil(x); }},
+};
+
+inline const BinaryFunction binaryFunctions[] = {
+    {"min", [](double a, double b) { return std::fmin(a, b); }},
+    {"max", [](double a, double b) { return std::fmax(a, b); }},
+    {"pow", [](double a, double b) { return std::pow(a, b); }},
+};
+
+// Named constants are folded in at compile time
+inline constexpr std::pair<std::string_view, double> namedConstants[] = {
+    {"pi", 3.14159265358979323846},
+    {"e", 2.71828182845904523536},
+};
+
+inline bool isConstantName(std::string_view name) {
+    for (const auto& [constantName, value] : namedConstants) {
+        if (constantName == name) {
+            return true;
+        }
+    }
+    return false;
+}
+
+class CompiledExpression {
+public:
+    // `slots` holds one value per entry of variables(), in the same order
+    double evaluate(std::span<const double> slots) const;
+    // Convenience for one-off evaluation; throws std::invalid_argument for an unbound variable
+    double evaluate(const std::unordered_map<std::string, double>& variables) const;
+
+    const std::vector<std::string>& variables() const { return variables_; }
+    std::optional<std::size_t> slotOf(std::string_view name) const;
+    std::size_t instructionCount() const { return code_.size(); }
+
+private:
+    friend class Compiler;
+
+    std::vector<Instruction> code_;
+    std::vector<double> constants_;
+    std::vector<std::string> variables_;
+    std::size_t maxStack_ = 0;  // deepest the value stack gets, known after compiling
+};
+
+// Single-pass recursive descent: bytecode is emitted as the input is parsed,
+// with no syntax tree in between
+class Compiler {
+public:
+    explicit Compiler(std::string_view text) : text_(text) {}
+
+    CompiledExpression compile() {
+        parseExpression();
+        skipSpaces();
+        if (pos_ != text_.size()) {
+            fail("Unexpected '" + std::string(1, text_[pos_]) + "'");
+        }
+        return std::move(result_);
+    }
+
+private:
+    // Every recursive path (signs, '^' chains, parentheses, call arguments)
+    // goes through parseUnary, so bounding its nesting bounds the C++ stack
+    static constexpr std::size_t kMaxNesting = 256;
+
+    std::string_view text_;
+    std::size_t pos_ = 0;
+    std::size_t depth_ = 0;
+    std::size_t nesting_ = 0;
+    CompiledExpression result_;
+
+    [[noreturn]] void fail(const std::string& message) const {
+        throw std::invalid_argument(message + " at position " + std::to_string(pos_ + 1));
+    }
+
+    void skipSpaces() {
+        while (pos_ < text_.size() && std::isspace(static_cast<unsigned char>(text_[pos_]))) {
+            pos_++;
+        }
+    }
+
+    bool accept(char c) {
+        skipSpaces();
+        if (pos_ < text_.size() && text_[pos_] == c) {
+            pos_++;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(char c) {
+        if (!accept(c)) {
+            fail(std::string("Expected '") + c + "'");
+        }
+    }
+
+    void emit(OpCode op, std::uint32_t operand, int stackEffect) {
+        result_.code_.push_back({op, operand});
+        depth_ = static_cast<std::size_t>(static_cast<long>(depth_) + stackEffect);
+        result_.maxStack_ = std::max(result_.maxStack_, depth_);
+    }
+
+    void emitConstant(double value) {
+        result_.constants_.push_back(value);
+        emit(OpCode::Const, static_cast<std::uint32_t>(result_.constants_.size() - 1), +1);
+    }
+
+    bool endsWithConstants(std::size_t count) const {
+        const auto& code = result_.code_;
+        if (code.size() < count) {
+            return false;
+        }
+        for (std::size_t i = code.size() - count; i < code.size(); ++i) {
+            if (code[i].op != OpCode::Const) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Take the trailing constant back off the program, e.g. to fold it
+    double popConstant() {
+        double value = result_.constants_[result_.code_.back().operand];
+        result_.code_.pop_back();
+        result_.constants_.pop_back();
+        depth_--;
+        return value;
+    }
+
+    static double applyBinary(OpCode op, double a, double b) {
         switch (op) {
-            case '+': return Result<double>(a + b);
-            case '-': return Result<double>(a - b);
-            case '*': return Result<double>(a * b);
-            case '/': 
-                if (b == 0) return Result<double>("Division by zero");
-                return Result<double>(a / b);
-            default: 
-                return Result<double>("Unknown operation");
+            case OpCode::Add: return a + b;
+            case OpCode::Subtract: return a - b;
+            case OpCode::Multiply: return a * b;
+            case OpCode::Divide: return a / b;
+            case OpCode::Modulo: return std::fmod(a, b);
+            case OpCode::Power: return std::pow(a, b);
+            default: return 0.0;
         }
     }
-    catch (const std::exception& e) {
-        return Result<double>(std::string("Error: ") + e.what());
+
+    // An operator whose operands are both literals becomes one constant.
+    // Each operand leaves exactly one value, so two trailing Const
+    // instructions can only be the two operands themselves.
+    void emitBinary(OpCode op) {
+        if (endsWithConstants(2)) {
+            double b = popConstant();
+            double a = popConstant();
+            emitConstant(applyBinary(op, a, b));
+            return;
+        }
+        emit(op, 0, -1);
+    }
+
+    void parseExpression() {
+        parseTerm();
+        while (true) {
+            if (accept('+')) {
+                parseTerm();
+                emitBinary(OpCode::Add);
+            } else if (accept('-')) {
+                parseTerm();
+                emitBinary(OpCode::Subtract);
+            } else {
+                return;
+            }
+        }
+    }
+
+    void parseTerm() {
+        parseUnary();
+        while (true) {
+            if (accept('*')) {
+                parseUnary();
+                emitBinary(OpCode::Multiply);
+            } else if (accept('/')) {
+                parseUnary();
+                emitBinary(OpCode::Divide);
+            } else if (accept('%')) {
+                parseUnary();
+                emitBinary(OpCode::Modulo);
+            } else {
+                return;
+            }
+        }
+    }
+
+    void parseUnary() {
+        if (++nesting_ > kMaxNesting) {
+            fail("Expression nested too deeply");
+        }
+        if (accept('-')) {
+            parseUnary();
+            if (endsWithConstants(1)) {
+                emitConstant(-popConstant());
+            } else {
+                emit(OpCode::Negate, 0, 0);
+            }
+        } else if (accept('+')) {
+            parseUnary();
+        } else {
+            parsePower();
+        }
+        nesting_--;
+    }
+
+    void parsePower() {
+        parsePrimary();
+        if (accept('^')) {
+            parseUnary();
+            emitBinary(OpCode::Power);
+        }
+    }
+
+    void parsePrimary() {
+        skipSpaces();
+        if (pos_ == text_.size()) {
+            fail("Unexpected end of expression");
+        }
+
+        char c = text_[pos_];
+        if (accept('(')) {
+            parseExpression();
+            expect(')');
+        } else if (std::isdigit(static_cast<unsigned char>(c)) || c == '.') {
+            double value = 0.0;
+            auto [next, ec] = std::from_chars(text_.data() + pos_, text_.data() + text_.size(), value);
+            if (ec != std::errc()) {
+                fail("Invalid number");
+            }
+            pos_ = static_cast<std::size_t>(next - text_.data());
+            emitConstant(value);
+        } else if (std::isalpha(static_cast<unsigned char>(c)) || c == '_') {
+            std::size_t start = pos_;
+            while (pos_ < text_.size() &&
+                   (std::isalnum(static_cast<unsigned char>(text_[pos_])) || text_[pos_] == '_')) {
+                pos_++;
+            }
+            std::string_view name = text_.substr(start, pos_ - start);
+            if (accept('(')) {
+                parseCall(name);
+            } else {
+                parseName(name);
+            }
+        } else {
+            fail("Unexpected '" + std::string(1, c) + "'");
+        }
+    }
+
+    void parseCall(std::string_view name) {
+        int arity = 0;
+        if (!accept(')')) {
+            do {
+                parseExpression();
+                arity++;
+            } while (accept(','));
+            expect(')');
+        }
+
+        if (arity == 1) {
+            for (std::size_t i = 0; i < std::size(unaryFunctions); ++i) {
+                if (unaryFunctions[i].name == name) {
+                    emit(OpCode::Call1, static_cast<std::uint32_t>(i), 0);
+                    return;
+                }
+            }
+        } else if (arity == 2) {
+            for (std::size_t i = 0; i < std::size(binaryFunctions); ++i) {
+                if (binaryFunctions[i].name == name) {
+                    emit(OpCode::Call2, static_cast<std::uint32_t>(i), -1);
+                    return;
+                }
+            }
+        }
+        fail("Unknown function " + std::string(name) + " with " + std::to_string(arity) + " argument(s)");
+    }
+
+    void parseName(std::string_view name) {
+        for (const auto& [constantName, value] : namedConstants) {
+            if (constantName == name) {
+                emitConstant(value);
+                return;
+            }
+        }
+
+        auto& variables = result_.variables_;
+        auto slot = std::find(variables.begin(), variables.end(), name);
+        if (slot == variables.end()) {
+            slot = variables.insert(variables.end(), std::string(name));
+        }
+        emit(OpCode::Load, static_cast<std::uint32_t>(slot - variables.begin()), +1);
+    }
+};
+
+// Throws std::invalid_argument with the position of the first syntax error
+inline CompiledExpression compile(std::string_view text) {
+    return Compiler(text).compile();
+}
+
+double CompiledExpression::evaluate(std::span<const double> slots) const {
+    if (slots.size() < variables_.size()) {
+        throw std::invalid_argument("Expected " + std::to_string(variables_.size()) + " variable values");
+    }
+
+    // Almost every expression fits the fixed stack; only very deep nesting allocates
+    constexpr std::size_t kInlineStack = 32;
+    double inlineStack[kInlineStack];
+    std::vector<double> heapStack;
+    double* top = inlineStack;
+    if (maxStack_ > kInlineStack) {
+        heapStack.resize(maxStack_);
+        top = heapStack.data();
+    }
+
+    // `top` points one past the topmost value
+    for (const Instruction& instruction : code_) {
+        switch (instruction.op) {
+            case OpCode::Const:
+                *top++ = constants_[instruction.operand];
+                break;
+            case OpCode::Load:
+                *top++ = slots[instruction.operand];
+                break;
+            case OpCode::Add:
+                --top;
+                top[-1] += top[0];
+                break;
+            case OpCode::Subtract:
+                --top;
+                top[-1] -= top[0];
+                break;
+            case OpCode::Multiply:
+                --top;
+                top[-1] *= top[0];
+                break;
+            case OpCode::Divide:
+                --top;
+                top[-1] /= top[0];
+                break;
+            case OpCode::Modulo:
+                --top;
+                top[-1] = std::fmod(top[-1], top[0]);
+                break;
+            case OpCode::Power:
+                --top;
+                top[-1] = std::pow(top[-1], top[0]);
+                break;
+            case OpCode::Negate:
+                top[-1] = -top[-1];
+                break;
+            case OpCode::Call1:
+                top[-1] = unaryFunctions[instruction.operand].fn(top[-1]);
+                break;
+            case OpCode::Call2:
+                --top;
+                top[-1] = binaryFunctions[instruction.operand].fn(top[-1], top[0]);
+                break;
+        }
+    }
+    return top[-1];
+}
+
+double CompiledExpression::evaluate(const std::unordered_map<std::string, double>& variables) const {
+    std::vector<double> slots;
+    slots.reserve(variables_.size());
+    for (const std::string& name : variables_) {
+        auto it = variables.find(name);
+        if (it == variables.end()) {
+            throw std::invalid_argument("Unknown variable " + name);
+        }
+        slots.push_back(it->second);
+    }
+    return evaluate(slots);
+}
+
+std::optional<std::size_t> CompiledExpression::slotOf(std::string_view name) const {
+    auto it = std::find(variables_.begin(), variables_.end(), name);
+    if (it == variables_.end()) {
+        return std::nullopt;
+    }
+    return static_cast<std::size_t>(it - variables_.begin());
+}
+
+} // namespace expr
+
+void printHelp() {
+    std::cout << "\nEnter an expression, e.g. (1 + 2) * 3 or sqrt(x^2 + y^2)" << std::endl;
+    std::cout << "  name = expression   assign a variable (ans holds the last result)" << std::endl;
+    std::cout << "  operators: + - * / % ^ and parentheses" << std::endl;
+    std::cout << "  functions: sqrt abs exp log sin cos tan floor ceil min max pow" << std::endl;
+    std::cout << "  constants: pi e" << std::endl;
+    std::cout << "  help, exit" << std::endl;
+}
+
+int runCalculatorRepl() {
+    std::unordered_map<std::string, double> variables{{"ans", 0.0}};
+    std::string line;
+
+    printHelp();
+    while (true) {
+        std::cout << "> " << std::flush;
+        if (!std::getline(std::cin, line)) {
+            break;
+        }
+
+        try {
+            auto first = line.find_first_not_of(" \t\r");
+            if (first == std::string::npos) {
+                continue;
+            }
+            std::string_view input(line);
+            input = input.substr(first, input.find_last_not_of(" \t\r") - first + 1);
+
+            if (input == "exit" || input == "quit") {
+                std::cout << "Goodbye!" << std::endl;
+                break;
+            }
+            if (input == "help") {
+                printHelp();
+                continue;
+            }
+
+            // "name = expression" stores the result under `name` as well as in ans
+            std::string target;
+            auto equals = input.find('=');
+            if (equals != std::string_view::npos) {
+                std::string_view name = input.substr(0, equals);
+                name = name.substr(0, name.find_last_not_of(" \t") + 1);
+                bool validName = !name.empty() && !std::isdigit(static_cast<unsigned char>(name[0])) &&
+                    std::all_of(name.begin(), name.end(), [](char c) {
+                        return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+                    });
+                if (!validName) {
+                    throw std::invalid_argument("Invalid variable name");
+                }
+                if (expr::isConstantName(name)) {
+                    throw std::invalid_argument("Cannot assign to constant " + std::string(name));
+                }
+                target = name;
+                input = input.substr(equals + 1);
+            }
+
+            double value = expr::compile(input).evaluate(variables);
+            if (!std::isfinite(value)) {
+                throw std::runtime_error("Result is not a finite number (division by zero?)");
+            }
+
+            variables["ans"] = value;
+            if (!target.empty()) {
+                variables[target] = value;
+                std::cout << target << " = ";
+            }
+            format::write(std::cout, value) << std::endl;
+        }
+        catch (const std::invalid_argument& e) {
+            std::cerr << "Input Error: " << e.what() << std::endl;
+        }
+        catch (const std::runtime_error& e) {
+            std::cerr << "Runtime Error: " << e.what() << std::endl;
+        }
+        catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
+    }
+    return 0;
+}
+
+// Compiling once and binding slots, against compiling for every input
+void benchmarkExpressionVm() {
+    using Clock = std::chrono::steady_clock;
+    constexpr int kInputs = 1000000;
+    const std::string formula = "3*x^2 + 2*x - sqrt(abs(x)) / (1 + x*x)";
+
+    auto perEvaluation = [](Clock::duration elapsed) {
+        return std::chrono::duration<double, std::nano>(elapsed).count() / kInputs;
+    };
+
+    double sum = 0.0;
+    auto start = Clock::now();
+    for (int i = 0; i < kInputs; ++i) {
+        double x = i * 1e-3;
+        sum += expr::compile(formula).evaluate(std::span<const double>(&x, 1));
+    }
+    double reparse = perEvaluation(Clock::now() - start);
+
+    expr::CompiledExpression compiled = expr::compile(formula);
+    double slots[1];
+    start = Clock::now();
+    for (int i = 0; i < kInputs; ++i) {
+        slots[0] = i * 1e-3;
+        sum += compiled.evaluate(slots);
+    }
+    double reuse = perEvaluation(Clock::now() - start);
+
+    std::cout << formula << " (" << compiled.instructionCount() << " instructions)" << std::endl;
+    std::cout << "compile every time: " << reparse << " ns/eval" << std::endl;
+    std::cout << "compiled once:      " << reuse << " ns/eval" << std::endl;
+    std::cout << "(checksum " << sum << ")" << std::endl;
+}
+
+// 17. COMPILED-EXPRESSION CACHE:
+// Maps expression text to its CompiledExpression so repeated formulas skip
+// parsing and compilation entirely. Keys are normalized first, so "x*2" and
+// " x * 2 " share an entry. The cache is split into shards with one mutex
+// each, and every shard evicts its least recently used entry when full.
+namespace expr {
+
+// Drops whitespace except where it separates two name or number characters
+// ("a b" stays an error instead of turning into the variable "ab"), or
+// either side of a sign that follows an 'e' ("1e -5" and "1e- 5" stay errors
+// instead of becoming 1e-5). A kept space is always harmless: compile()
+// skips spaces between tokens, so the key is accepted exactly when the text is.
+inline void normalizeInto(std::string_view text, std::string& out) {
+    auto isWordChar = [](char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.';
+    };
+    auto isExponent = [](char c) { return c == 'e' || c == 'E'; };
+    auto isSign = [](char c) { return c == '+' || c == '-'; };
+
+    out.clear();
+    bool pendingSpace = false;
+    for (char c : text) {
+        if (std::isspace(static_cast<unsigned char>(c))) {
+            pendingSpace = true;
+            continue;
+        }
+        if (pendingSpace && !out.empty() &&
+            ((isWordChar(out.back()) && isWordChar(c)) ||
+             (isExponent(out.back()) && isSign(c)) ||
+             (isSign(out.back()) && out.size() > 1 && isExponent(out[out.size() - 2])))) {
+            out.push_back(' ');
+        }
+        pendingSpace = false;
+        out.push_back(c);
+    }
+}
+
+class ExpressionCache {
+public:
+    struct Stats {
+        std::uint64_t hits;
+        std::uint64_t misses;
+        std::uint64_t evictions;
+        std::size_t size;
+    };
+
+    // Holds at most max(capacity, 1) entries: there are never more shards
+    // than entries, and the per-shard limit rounds down
+    explicit ExpressionCache(std::size_t capacity = 1024, std::size_t shardCount = 16)
+        : shards_(std::clamp<std::size_t>(shardCount, 1, std::max<std::size_t>(capacity, 1)))
+        , shardCapacity_(std::max<std::size_t>(capacity / shards_.size(), 1)) {}
+
+    // Compiled outside the shard lock, so one slow compile never blocks
+    // lookups of other formulas. Throws std::invalid_argument like compile();
+    // failures are not cached.
+    std::shared_ptr<const CompiledExpression> get(std::string_view text) {
+        // Reused per thread, so a hit does not allocate
+        thread_local std::string key;
+        normalizeInto(text, key);
+
+        std::size_t hash = std::hash<std::string_view>{}(key);
+        Shard& shard = shards_[hash % shards_.size()];
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto it = shard.index.find(key);
+            if (it != shard.index.end()) {
+                shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+                hits_++;
+                return it->second->compiled;
+            }
+        }
+
+        misses_++;
+        std::shared_ptr<const CompiledExpression> compiled;
+        try {
+            compiled = std::make_shared<const CompiledExpression>(compile(key));
+        } catch (const std::invalid_argument&) {
+            // The position in the message counts characters of the normalized
+            // key. Compiling the caller's own text fails the same way but
+            // reports where the mistake is in what they typed.
+            compile(text);
+            throw;
+        }
+
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.index.find(key);
+        if (it != shard.index.end()) {
+            // Another thread compiled the same formula meanwhile; keep one copy
+            shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+            return it->second->compiled;
+        }
+        shard.entries.push_front({key, compiled});
+        shard.index.emplace(shard.entries.front().key, shard.entries.begin());
+        if (shard.entries.size() > shardCapacity_) {
+            // Callers still holding the evicted expression keep it alive
+            shard.index.erase(shard.entries.back().key);
+            shard.entries.pop_back();
+            evictions_++;
+        }
+        return compiled;
+    }
+
+    Stats stats() const {
+        std::size_t size = 0;
+        for (const Shard& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            size += shard.entries.size();
+        }
+        return {hits_.load(), misses_.load(), evictions_.load(), size};
+    }
+
+    void clear() {
+        for (Shard& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.index.clear();
+            shard.entries.clear();
+        }
+    }
+
+private:
+    struct Entry {
+        std::string key;
+        std::shared_ptr<const CompiledExpression> compiled;
+    };
+
+    // Front is most recently used. The index's keys view the list's strings,
+    // which never move because list nodes are stable, so a lookup with the
+    // normalized buffer needs no std::string.
+    struct Shard {
+        mutable std::mutex mutex;
+        std::list<Entry> entries;
+        std::unordered_map<std::string_view, std::list<Entry>::iterator> index;
+    };
+
+    std::vector<Shard> shards_;
+    std::size_t shardCapacity_;
+    std::atomic<std::uint64_t> hits_{0};
+    std::atomic<std::uint64_t> misses_{0};
+    std::atomic<std::uint64_t> evictions_{0};
+};
+
+} // namespace expr
+
+// Normalization must never change the outcome: every input has to be
+// accepted or rejected the same way, and give the same value, whether it
+// goes through the cache or straight to compile(). Returns false and prints
+// the first input that differs.
+bool expressionCacheMatchesCompile() {
+    const char* inputs[] = {
+        "x*2", " x * 2 ", "1e5", "1e+5", "1e-5", "1e +5", "1e+ 5", "1e - 5", "1E- 5",
+        "2 e+ 5", "e + 5", "e +5", "1 .5", "1. 5", "a b", "sqrt (x)", "x +", "(1 + 2",
+    };
+
+    expr::ExpressionCache cache(4);
+    for (const char* input : inputs) {
+        std::optional<double> direct;
+        std::optional<double> cached;
+        double x = 3.0;
+        try {
+            direct = expr::compile(input).evaluate(std::span<const double>(&x, 1));
+        } catch (const std::invalid_argument&) {
+        }
+        // Twice, so both the miss and the hit are compared
+        for (int pass = 0; pass < 2; ++pass) {
+            try {
+                cached = cache.get(input)->evaluate(std::span<const double>(&x, 1));
+            } catch (const std::invalid_argument&) {
+                cached.reset();
+            }
+            bool same = direct.has_value() == cached.has_value() &&
+                        (!direct || *direct == *cached || (std::isnan(*direct) && std::isnan(*cached)));
+            if (!same) {
+                std::cout << "Cache disagrees with compile() on \"" << input << "\"" << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// A few hundred formulas evaluated repeatedly from several threads, with
+// and without the cache
+void benchmarkExpressionCache(std::size_t threadCount = 4) {
+    using Clock = std::chrono::steady_clock;
+    if (!expressionCacheMatchesCompile()) {
+        return;
+    }
+    constexpr int kFormulas = 300;
+    constexpr int kEvaluationsPerThread = 200000;
+
+    std::vector<std::string> formulas;
+    for (int i = 0; i < kFormulas; ++i) {
+        formulas.push_back(std::to_string(i) + " * x^2 + sqrt(abs(x - " + std::to_string(i) + "))");
+    }
+
+    auto run = [&](auto&& lookup) {
+        std::vector<std::thread> threads;
+        auto start = Clock::now();
+        for (std::size_t t = 0; t < threadCount; ++t) {
+            threads.emplace_back([&, t] {
+                double x = static_cast<double>(t);
+                double sum = 0.0;
+                for (int i = 0; i < kEvaluationsPerThread; ++i) {
+                    sum += lookup(formulas[(i * 7 + t) % kFormulas])->evaluate(std::span<const double>(&x, 1));
+                }
+                if (sum == -1.0) {
+                    std::cout << sum;  // keeps the loop from being optimized away
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        return threadCount * kEvaluationsPerThread / seconds;
+    };
+
+    double uncached = run([](const std::string& text) {
+        return std::make_shared<const expr::CompiledExpression>(expr::compile(text));
+    });
+
+    expr::ExpressionCache cache(1024);
+    double cached = run([&](const std::string& text) { return cache.get(text); });
+
+    auto stats = cache.stats();
+    std::cout << threadCount << " threads, " << kFormulas << " formulas" << std::endl;
+    std::cout << "compile every time: " << static_cast<long>(uncached) << " evals/s" << std::endl;
+    std::cout << "cached:             " << static_cast<long>(cached) << " evals/s" << std::endl;
+    std::cout << "hits " << stats.hits << ", misses " << stats.misses
+              << ", evictions " << stats.evictions << ", size " << stats.size << std::endl;
+}
+
+// 18. STATIC-DISPATCH CALCULATOR:
+// Calculator pays a virtual call in performOperation and assigns a
+// std::string operationName on every operation. FastCalculator resolves
+// the operation at compile time through CRTP and records it as a one-byte
+// enum, so an add in a loop compiles down to the addition plus two stores.
+enum class Operation : std::uint8_t { None, Addition, Subtraction, Multiplication, Division };
+
+constexpr std::string_view operationName(Operation operation) {
+    switch (operation) {
+        case Operation::Addition: return "Addition";
+        case Operation::Subtraction: return "Subtraction";
+        case Operation::Multiplication: return "Multiplication";
+        case Operation::Division: return "Division";
+        case Operation::None: break;
+    }
+    return "";
+}
+
+// Operation policies: the arithmetic and its name, both usable at compile time
+struct AddOp {
+    static constexpr Operation kind = Operation::Addition;
+    static constexpr double apply(double a, double b) { return a + b; }
+};
+
+struct SubtractOp {
+    static constexpr Operation kind = Operation::Subtraction;
+    static constexpr double apply(double a, double b) { return a - b; }
+};
+
+struct MultiplyOp {
+    static constexpr Operation kind = Operation::Multiplication;
+    static constexpr double apply(double a, double b) { return a * b; }
+};
+
+// Callers check for a zero divisor first (see CalculatorBase::divide)
+struct DivideOp {
+    static constexpr Operation kind = Operation::Division;
+    static constexpr double apply(double a, double b) { return a / b; }
+};
+
+// Shared operations; Derived decides what is recorded through record()
+template<typename Derived>
+class CalculatorBase {
+public:
+    template<typename Op>
+    constexpr double compute(double a, double b) {
+        double value = Op::apply(a, b);
+        derived().record(Op::kind, value);
+        return value;
+    }
+
+    constexpr double add(double a, double b) { return compute<AddOp>(a, b); }
+    constexpr double subtract(double a, double b) { return compute<SubtractOp>(a, b); }
+    constexpr double multiply(double a, double b) { return compute<MultiplyOp>(a, b); }
+
+    // Like Calculator::divide, a zero divisor is not recorded as an operation
+    constexpr CalcResult divide(double a, double b) {
+        if (b == 0) {
+            return {0.0, CalcError::DivisionByZero};
+        }
+        return {compute<DivideOp>(a, b), CalcError::None};
+    }
+
+private:
+    constexpr Derived& derived() { return static_cast<Derived&>(*this); }
+};
+
+class FastCalculator : public CalculatorBase<FastCalculator> {
+public:
+    constexpr double getResult() const { return result_; }
+    constexpr int getOperationsPerformed() const { return operationsPerformed_; }
+    constexpr Operation getOperation() const { return operation_; }
+    constexpr std::string_view getOperationName() const { return operationName(operation_); }
+
+private:
+    friend class CalculatorBase<FastCalculator>;
+
+    constexpr void record(Operation operation, double value) {
+        result_ = value;
+        operation_ = operation;
+        operationsPerformed_++;
+    }
+
+    double result_ = 0;
+    int operationsPerformed_ = 0;
+    Operation operation_ = Operation::None;
+};
+
+// Everything above works in constant expressions
+static_assert([] {
+    FastCalculator calc;
+    calc.add(2, 3);
+    calc.multiply(calc.getResult(), 4);
+    return calc.getResult() == 20 && calc.getOperationsPerformed() == 2 &&
+           calc.getOperationName() == "Multiplication";
+}());
+
+// Thin adapter for code written against MathOperations: one virtual call,
+// then the statically dispatched operation
+template<typename Op>
+class StaticOperation : public MathOperations {
+public:
+    explicit StaticOperation(FastCalculator& calculator) : calculator_(calculator) {}
+
+    double performOperation(double a, double b) override {
+        if constexpr (Op::kind == Operation::Division) {
+            if (b == 0) {
+                throw DivisionByZeroException();
+            }
+        }
+        return calculator_.compute<Op>(a, b);
+    }
+
+    std::string getOperationName() const override {
+        return std::string(operationName(Op::kind));
+    }
+
+private:
+    FastCalculator& calculator_;
+};
+
+// Per-operation cost of the virtual path, Calculator::add and FastCalculator::add.
+// The volatile pointer keeps the compiler from devirtualizing the first loop.
+void benchmarkStaticDispatch() {
+    using Clock = std::chrono::steady_clock;
+    constexpr int kOperations = 50000000;
+
+    auto nanosPerOperation = [](Clock::time_point start) {
+        return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / kOperations;
+    };
+
+    Calculator calc;
+    MathOperations* volatile virtualOps = &calc;
+    double sum = 0.0;
+    auto start = Clock::now();
+    for (int i = 0; i < kOperations; ++i) {
+        sum = virtualOps->performOperation(sum, 1.0);
+    }
+    double virtualCall = nanosPerOperation(start);
+
+    start = Clock::now();
+    for (int i = 0; i < kOperations; ++i) {
+        sum = calc.add(sum, 1.0);
+    }
+    double directCall = nanosPerOperation(start);
+
+    FastCalculator fast;
+    start = Clock::now();
+    for (int i = 0; i < kOperations; ++i) {
+        sum = fast.add(sum, 1.0);
+    }
+    double staticCall = nanosPerOperation(start);
+
+    std::cout << "virtual performOperation: " << virtualCall << " ns/op" << std::endl;
+    std::cout << "Calculator::add:          " << directCall << " ns/op" << std::endl;
+    std::cout << "FastCalculator::add:      " << staticCall << " ns/op" << std::endl;
+    std::cout << "(checksum " << sum << ", " << calc.getOperationsPerformed() + fast.getOperationsPerformed()
+              << " operations)" << std::endl;
+}
+
+// 19. STREAMING BATCH MODE:
+// `calculator --batch [file]` reads one "op a b" line at a time (op is
+// add/sub/mul/div or + - * /) from the file or stdin and writes one result
+// line per input line. Input is read in 1 MiB blocks, numbers are parsed
+// with std::from_chars, and results collect in a string that is written
+// once per megabyte, so no line costs a flush or a locale lookup.
+inline std::optional<Operation> parseOperation(std::string_view token) {
+    if (token == "add" || token == "+") {
+        return Operation::Addition;
+    }
+    if (token == "sub" || token == "-") {
+        return Operation::Subtraction;
+    }
+    if (token == "mul" || token == "*") {
+        return Operation::Multiplication;
+    }
+    if (token == "div" || token == "/") {
+        return Operation::Division;
+    }
+    return std::nullopt;
+}
+
+// Appends the result line for `line` (without its '\n') to `out`.
+// Returns false for a malformed line or a zero divisor.
+inline bool evaluateBatchLine(std::string_view line, FastCalculator& calc, std::string& out) {
+    const char* p = line.data();
+    const char* end = p + line.size();
+    if (p != end && end[-1] == '\r') {
+        --end;
+    }
+    auto skipBlanks = [&] {
+        while (p < end && (*p == ' ' || *p == '\t')) {
+            ++p;
+        }
+    };
+
+    skipBlanks();
+    if (p == end) {
+        out.push_back('\n');  // blank lines pass through, keeping output aligned with input
+        return true;
+    }
+
+    const char* token = p;
+    while (p < end && *p != ' ' && *p != '\t') {
+        ++p;
+    }
+    auto operation = parseOperation(std::string_view(token, static_cast<std::size_t>(p - token)));
+
+    double a = 0.0;
+    double b = 0.0;
+    skipBlanks();
+    auto first = std::from_chars(p, end, a);
+    p = first.ptr;
+    skipBlanks();
+    auto second = std::from_chars(p, end, b);
+    p = second.ptr;
+    skipBlanks();
+
+    if (!operation || first.ec != std::errc() || second.ec != std::errc() || p != end) {
+        out.append("Error: Malformed line\n");
+        return false;
+    }
+
+    bool ok = true;
+    switch (*operation) {
+        case Operation::Addition:
+            format::append(out, calc.add(a, b));
+            break;
+        case Operation::Subtraction:
+            format::append(out, calc.subtract(a, b));
+            break;
+        case Operation::Multiplication:
+            format::append(out, calc.multiply(a, b));
+            break;
+        case Operation::Division: {
+            CalcResult result = calc.divide(a, b);
+            format::append(out, result);
+            ok = result.ok();
+            break;
+        }
+        case Operation::None:
+            break;
+    }
+    out.push_back('\n');
+    return ok;
+}
+
+int runCalculatorBatch(const char* path) {
+    bool fromStdin = path == nullptr || std::string_view(path) == "-";
+    std::FILE* in = fromStdin ? stdin : std::fopen(path, "rb");
+    if (in == nullptr) {
+        std::cerr << "Error: Could not open " << path << std::endl;
+        return 1;
+    }
+
+    constexpr std::size_t kBlockSize = 1 << 20;
+    std::vector<char> buffer(kBlockSize);
+    std::string out;
+    out.reserve(kBlockSize + 4096);
+
+    FastCalculator calc;
+    std::uint64_t lines = 0;
+    std::uint64_t errors = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    auto process = [&](const char* begin, const char* end) {
+        errors += !evaluateBatchLine(std::string_view(begin, static_cast<std::size_t>(end - begin)), calc, out);
+        lines++;
+        if (out.size() >= kBlockSize) {
+            std::fwrite(out.data(), 1, out.size(), stdout);
+            out.clear();
+        }
+    };
+
+    std::size_t carried = 0;  // bytes of an unfinished line kept at the front of `buffer`
+    while (true) {
+        std::size_t got = std::fread(buffer.data() + carried, 1, buffer.size() - carried, in);
+        const char* p = buffer.data();
+        const char* end = p + carried + got;
+
+        if (got == 0) {
+            if (p != end) {
+                process(p, end);  // last line without a trailing '\n'
+            }
+            break;
+        }
+
+        while (const char* newline = static_cast<const char*>(std::memchr(p, '\n', static_cast<std::size_t>(end - p)))) {
+            process(p, newline);
+            p = newline + 1;
+        }
+
+        carried = static_cast<std::size_t>(end - p);
+        std::memmove(buffer.data(), p, carried);
+        if (carried == buffer.size()) {
+            buffer.resize(buffer.size() * 2);  // one line longer than the buffer
+        }
+    }
+
+    std::fwrite(out.data(), 1, out.size(), stdout);
+    std::fflush(stdout);
+    bool readFailed = std::ferror(in) != 0;
+    if (!fromStdin) {
+        std::fclose(in);
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << lines << " lines, " << errors << " errors, " << seconds << " s ("
+              << static_cast<long>(lines / std::max(seconds, 1e-9)) << " lines/s)" << std::endl;
+    if (readFailed) {
+        std::cerr << "Error: Could not read input" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// 20. PARALLEL MEMORY-MAPPED BATCH MODE:
+// `calculator --batch file --threads N` maps the whole file instead of
+// reading it, cuts it into line-aligned chunks and evaluates the chunks on
+// N workers. Each chunk's results go into its own string, and the calling
+// thread writes those strings strictly in chunk order, so the output is
+// byte-for-byte what the single-threaded mode produces.
+//
+// Chunks are dealt round-robin into per-worker deques. A worker takes from
+// the front of its own deque and, once that is empty, steals the oldest
+// chunk any other worker still has queued: output is written in order, so
+// the oldest pending chunk is the one holding the writer back. Workers stay
+// at most kWindow chunks ahead of the writer, which bounds the memory held
+// by finished but unwritten output.
+#if defined(__unix__) || defined(__APPLE__)
+
+class ChunkScheduler {
+public:
+    ChunkScheduler(std::size_t chunkCount, std::size_t workerCount) : queues_(workerCount) {
+        for (std::size_t chunk = 0; chunk < chunkCount; ++chunk) {
+            queues_[chunk % workerCount].chunks.push_back(chunk);
+        }
+    }
+
+    std::optional<std::size_t> next(std::size_t worker) {
+        {
+            WorkerQueue& own = queues_[worker];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.chunks.empty()) {
+                std::size_t chunk = own.chunks.front();
+                own.chunks.pop_front();
+                return chunk;
+            }
+        }
+        return steal(worker);
+    }
+
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<std::size_t> chunks;
+    };
+
+    std::vector<WorkerQueue> queues_;
+
+    std::optional<std::size_t> steal(std::size_t thief) {
+        while (true) {
+            // Find the victim whose oldest chunk is the oldest overall
+            std::size_t victim = queues_.size();
+            std::size_t oldest = std::numeric_limits<std::size_t>::max();
+            for (std::size_t i = 0; i < queues_.size(); ++i) {
+                if (i == thief) {
+                    continue;
+                }
+                std::lock_guard<std::mutex> lock(queues_[i].mutex);
+                if (!queues_[i].chunks.empty() && queues_[i].chunks.front() < oldest) {
+                    oldest = queues_[i].chunks.front();
+                    victim = i;
+                }
+            }
+            if (victim == queues_.size()) {
+                return std::nullopt;  // nothing left anywhere
+            }
+
+            std::lock_guard<std::mutex> lock(queues_[victim].mutex);
+            auto& chunks = queues_[victim].chunks;
+            if (!chunks.empty()) {
+                std::size_t chunk = chunks.front();
+                chunks.pop_front();
+                return chunk;
+            }
+            // The victim drained its deque meanwhile; look again
+        }
+    }
+};
+
+int runParallelBatch(const char* path, std::size_t threadCount) {
+    constexpr std::size_t kChunkSize = 8 << 20;
+
+    int fd = ::open(path, O_RDONLY);
+    struct stat info {};
+    if (fd < 0 || ::fstat(fd, &info) != 0) {
+        std::cerr << "Error: Could not open " << path << std::endl;
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return 1;
+    }
+    std::size_t size = static_cast<std::size_t>(info.st_size);
+    if (size == 0) {
+        ::close(fd);
+        return 0;
+    }
+
+    void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Error: Could not map " << path << std::endl;
+        return 1;
+    }
+    ::madvise(mapping, size, MADV_SEQUENTIAL);
+    const char* data = static_cast<const char*>(mapping);
+    const char* dataEnd = data + size;
+
+    struct Chunk {
+        const char* begin;
+        const char* end;
+        std::string out;
+        std::uint64_t lines = 0;
+        std::uint64_t errors = 0;
+        bool done = false;
+    };
+
+    // Every boundary moves forward to just past the next '\n'
+    std::vector<Chunk> chunks;
+    for (const char* begin = data; begin < dataEnd;) {
+        const char* end = begin + std::min(kChunkSize, static_cast<std::size_t>(dataEnd - begin));
+        if (end < dataEnd) {
+            const void* newline = std::memchr(end, '\n', static_cast<std::size_t>(dataEnd - end));
+            end = newline ? static_cast<const char*>(newline) + 1 : dataEnd;
+        }
+        chunks.push_back({begin, end, {}});
+        begin = end;
+    }
+
+    // More workers than chunks would only sit idle
+    threadCount = std::min(threadCount, chunks.size());
+    const std::size_t kWindow = 4 * threadCount;
+
+    auto start = std::chrono::steady_clock::now();
+    ChunkScheduler scheduler(chunks.size(), threadCount);
+    std::mutex progressMutex;
+    std::condition_variable chunkDone;     // a worker finished a chunk
+    std::condition_variable chunkWritten;  // the writer moved forward
+    std::size_t written = 0;
+
+    auto work = [&](std::size_t worker) {
+        FastCalculator calc;
+        while (auto index = scheduler.next(worker)) {
+            {
+                std::unique_lock<std::mutex> lock(progressMutex);
+                chunkWritten.wait(lock, [&] { return *index < written + kWindow; });
+            }
+
+            Chunk& chunk = chunks[*index];
+            std::string out;
+            out.reserve(static_cast<std::size_t>(chunk.end - chunk.begin) + 4096);
+            for (const char* p = chunk.begin; p < chunk.end;) {
+                const char* newline = static_cast<const char*>(
+                    std::memchr(p, '\n', static_cast<std::size_t>(chunk.end - p)));
+                const char* lineEnd = newline ? newline : chunk.end;
+                chunk.errors += !evaluateBatchLine(
+                    std::string_view(p, static_cast<std::size_t>(lineEnd - p)), calc, out);
+                chunk.lines++;
+                p = lineEnd + 1;
+            }
+
+            std::lock_guard<std::mutex> lock(progressMutex);
+            chunk.out = std::move(out);
+            chunk.done = true;
+            chunkDone.notify_one();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (std::size_t worker = 0; worker < threadCount; ++worker) {
+        workers.emplace_back(work, worker);
+    }
+
+    std::uint64_t lines = 0;
+    std::uint64_t errors = 0;
+    for (Chunk& chunk : chunks) {
+        std::string out;
+        {
+            std::unique_lock<std::mutex> lock(progressMutex);
+            chunkDone.wait(lock, [&] { return chunk.done; });
+            out = std::move(chunk.out);
+        }
+        // Written outside the lock so workers keep going during the write
+        std::fwrite(out.data(), 1, out.size(), stdout);
+        lines += chunk.lines;
+        errors += chunk.errors;
+
+        std::lock_guard<std::mutex> lock(progressMutex);
+        written++;
+        chunkWritten.notify_all();
+    }
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    std::fflush(stdout);
+    ::munmap(mapping, size);
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << lines << " lines, " << errors << " errors, " << seconds << " s ("
+              << static_cast<long>(lines / std::max(seconds, 1e-9)) << " lines/s, "
+              << threadCount << " threads)" << std::endl;
+    return 0;
+}
+
+#else
+
+// No mmap: stream the file on one thread instead
+int runParallelBatch(const char* path, std::size_t) {
+    return runCalculatorBatch(path);
+}
+
+#endif
+
+// 21. THROWING VS NON-THROWING SAFECALCULATOR:
+// Divides a million pairs through safeDivide (exceptions) and tryDivide
+// (error codes) at several rates of bad input. Bad pairs are an even mix
+// of NaN, infinite and zero-divisor inputs, placed at random.
+void benchmarkSafeCalculator() {
+    using Clock = std::chrono::steady_clock;
+    constexpr std::size_t kPairs = 1000000;
+
+    SafeCalculator calc;
+    std::mt19937_64 random(42);
+    std::uniform_real_distribution<double> value(-1e6, 1e6);
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "error rate  throwing(ns/op)  non-throwing(ns/op)  speedup" << std::endl;
+    for (double errorRate : {0.0, 0.01, 0.20}) {
+        std::vector<double> a(kPairs), b(kPairs);
+        std::bernoulli_distribution isBad(errorRate);
+        for (std::size_t i = 0; i < kPairs; ++i) {
+            a[i] = value(random);
+            b[i] = value(random);
+            if (isBad(random)) {
+                switch (i % 3) {
+                    case 0: a[i] = std::numeric_limits<double>::quiet_NaN(); break;
+                    case 1: b[i] = std::numeric_limits<double>::infinity(); break;
+                    case 2: b[i] = 0.0; break;
+                }
+            }
+        }
+
+        double sum = 0.0;
+        std::size_t errors = 0;
+        auto start = Clock::now();
+        for (std::size_t i = 0; i < kPairs; ++i) {
+            try {
+                sum += calc.safeDivide(a[i], b[i]);
+            }
+            catch (const std::exception&) {
+                errors++;
+            }
+        }
+        double throwing = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / kPairs;
+
+        start = Clock::now();
+        for (std::size_t i = 0; i < kPairs; ++i) {
+            CalcResult result = calc.tryDivide(a[i], b[i]);
+            if (result.ok()) {
+                sum += result.value;
+            } else {
+                errors++;
+            }
+        }
+        double nonThrowing = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / kPairs;
+
+        std::cout << std::setw(9) << errorRate * 100 << "%" << std::setw(17) << throwing
+                  << std::setw(21) << nonThrowing << std::setw(8) << throwing / nonThrowing << "x" << std::endl;
+        if (sum == 1.0 && errors == 0) {
+            std::cout << sum;  // keeps both loops from being optimized away
+        }
+    }
+}
+
+// 22. VECTORIZED INPUT VALIDATION:
+// SafeCalculator checks std::isnan/std::isinf one pair at a time. For
+// batches, one SIMD pass marks every invalid lane in a bitmask (bit i%64
+// of mask[i/64]). The arithmetic kernels then run unchanged over the whole
+// block, and only the marked lanes take the scalar error path. A clean
+// block costs one extra streaming pass and no branches per element.
+namespace batch {
+
+enum class Check {
+    Finite,                 // a and b must be neither NaN nor infinite
+    FiniteNonZeroDivisor,   // ... and b must not be zero
+};
+
+// Returns the number of marked lanes; mask must hold (n + 63) / 64 words
+using ValidateKernel = std::size_t (*)(const double* a, const double* b, std::uint64_t* mask, std::size_t n);
+
+inline std::size_t countMarked(const std::uint64_t* mask, std::size_t n) {
+    std::size_t marked = 0;
+    for (std::size_t word = 0; word < (n + 63) / 64; ++word) {
+        marked += static_cast<std::size_t>(std::popcount(mask[word]));
+    }
+    return marked;
+}
+
+template<Check check>
+std::size_t scalarValidate(const double* a, const double* b, std::uint64_t* mask, std::size_t n) {
+    std::fill(mask, mask + (n + 63) / 64, 0);
+    for (std::size_t i = 0; i < n; ++i) {
+        bool invalid = !std::isfinite(a[i]) || !std::isfinite(b[i]);
+        if constexpr (check == Check::FiniteNonZeroDivisor) {
+            invalid |= b[i] == 0.0;
+        }
+        mask[i / 64] |= std::uint64_t(invalid) << (i % 64);
+    }
+    return countMarked(mask, n);
+}
+
+#ifdef CALCULATOR_HAS_X86_KERNELS
+
+// x * 0 is NaN exactly when x is NaN or infinite, so one unordered compare
+// of (a * 0 + b * 0) with itself tests both inputs at once
+template<Check check>
+__attribute__((target("avx2")))
+std::size_t avx2Validate(const double* a, const double* b, std::uint64_t* mask, std::size_t n) {
+    std::fill(mask, mask + (n + 63) / 64, 0);
+    const __m256d zero = _mm256_setzero_pd();
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = _mm256_loadu_pd(a + i);
+        __m256d y = _mm256_loadu_pd(b + i);
+        __m256d probe = _mm256_add_pd(_mm256_mul_pd(x, zero), _mm256_mul_pd(y, zero));
+        __m256d invalid = _mm256_cmp_pd(probe, probe, _CMP_UNORD_Q);
+        if constexpr (check == Check::FiniteNonZeroDivisor) {
+            invalid = _mm256_or_pd(invalid, _mm256_cmp_pd(y, zero, _CMP_EQ_OQ));
+        }
+        mask[i / 64] |= std::uint64_t(_mm256_movemask_pd(invalid)) << (i % 64);
+    }
+    for (; i < n; ++i) {
+        bool invalid = !std::isfinite(a[i]) || !std::isfinite(b[i]);
+        if constexpr (check == Check::FiniteNonZeroDivisor) {
+            invalid |= b[i] == 0.0;
+        }
+        mask[i / 64] |= std::uint64_t(invalid) << (i % 64);
+    }
+    return countMarked(mask, n);
+}
+
+template<Check check>
+__attribute__((target("avx512f")))
+std::size_t avx512Validate(const double* a, const double* b, std::uint64_t* mask, std::size_t n) {
+    std::fill(mask, mask + (n + 63) / 64, 0);
+    const __m512d zero = _mm512_setzero_pd();
+    for (std::size_t i = 0; i < n; i += 8) {
+        // Masked off lanes load as 0.0, so the compares are masked too,
+        // or the zero-divisor check would mark them
+        __mmask8 lanes = n - i >= 8 ? __mmask8(0xFF) : __mmask8((1u << (n - i)) - 1);
+        __m512d x = _mm512_maskz_loadu_pd(lanes, a + i);
+        __m512d y = _mm512_maskz_loadu_pd(lanes, b + i);
+        __m512d probe = _mm512_add_pd(_mm512_mul_pd(x, zero), _mm512_mul_pd(y, zero));
+        __mmask8 invalid = _mm512_mask_cmp_pd_mask(lanes, probe, probe, _CMP_UNORD_Q);
+        if constexpr (check == Check::FiniteNonZeroDivisor) {
+            invalid |= _mm512_mask_cmp_pd_mask(lanes, y, zero, _CMP_EQ_OQ);
+        }
+        mask[i / 64] |= std::uint64_t(invalid) << (i % 64);
+    }
+    return countMarked(mask, n);
+}
+
+#endif
+
+template<Check check>
+ValidateKernel validatorFor(Isa isa) {
+#ifdef CALCULATOR_HAS_X86_KERNELS
+    if (isa == Isa::Avx512) {
+        return avx512Validate<check>;
+    }
+    if (isa == Isa::Avx2) {
+        return avx2Validate<check>;
+    }
+#endif
+    (void)isa;
+    return scalarValidate<check>;
+}
+
+template<Check check>
+std::size_t validate(std::span<const double> a, std::span<const double> b, std::span<std::uint64_t> mask) {
+    if (a.size() != b.size() || mask.size() < (a.size() + 63) / 64) {
+        throw std::invalid_argument("Batch inputs must have equal length and the mask one bit per element");
+    }
+    static const ValidateKernel kernel = validatorFor<check>(activeIsa());
+    return kernel(a.data(), b.data(), mask.data(), a.size());
+}
+
+// Calls f(i) for every marked lane, lowest index first
+template<typename F>
+void forEachMarked(std::span<const std::uint64_t> mask, F&& f) {
+    for (std::size_t word = 0; word < mask.size(); ++word) {
+        for (std::uint64_t bits = mask[word]; bits != 0; bits &= bits - 1) {
+            f(word * 64 + static_cast<std::size_t>(std::countr_zero(bits)));
+        }
+    }
+}
+
+// Blocks keep the mask on the stack and the data in cache between the passes
+inline constexpr std::size_t kValidationBlock = 4096;
+
+} // namespace batch
+
+std::size_t SafeCalculator::tryAddBatch(std::span<const double> a, std::span<const double> b,
+                                        std::span<double> out, std::span<CalcError> errors) {
+    if (a.size() != b.size() || out.size() < a.size()) {
+        throw std::invalid_argument("Batch inputs must have equal length and fit in the output");
+    }
+    if (!errors.empty() && errors.size() < a.size()) {
+        throw std::invalid_argument("Error output must have one entry per element");
+    }
+
+    std::uint64_t mask[batch::kValidationBlock / 64];
+    std::size_t failures = 0;
+    bool lastFailed = false;
+    for (std::size_t start = 0; start < a.size(); start += batch::kValidationBlock) {
+        std::size_t length = std::min(batch::kValidationBlock, a.size() - start);
+        auto blockA = a.subspan(start, length);
+        auto blockB = b.subspan(start, length);
+        auto blockOut = out.subspan(start, length);
+
+        std::size_t marked = batch::validate<batch::Check::Finite>(blockA, blockB, mask);
+        batch::run<batch::Op::Add>(blockA, blockB, blockOut);
+        if (!errors.empty()) {
+            std::fill_n(errors.begin() + static_cast<std::ptrdiff_t>(start), length, CalcError::None);
+        }
+        if (marked == 0) {
+            continue;
+        }
+
+        failures += marked;
+        batch::forEachMarked(std::span<const std::uint64_t>(mask, (length + 63) / 64), [&](std::size_t lane) {
+            blockOut[lane] = std::numeric_limits<double>::quiet_NaN();
+            if (!errors.empty()) {
+                errors[start + lane] = checkInputs(blockA[lane], blockB[lane]);
+            }
+            lastFailed |= start + lane == a.size() - 1;
+        });
+    }
+
+    // Like tryAdd, only successful additions count as operations
+    bool lastSucceeded = !a.empty() && !lastFailed;
+    recordBatch("Addition", lastSucceeded ? std::optional(out[a.size() - 1]) : std::nullopt,
+                a.size() - failures);
+    return failures;
+}
+
+std::size_t SafeCalculator::tryDivideBatch(std::span<const double> a, std::span<const double> b,
+                                           std::span<double> out, std::span<CalcError> errors) const {
+    if (a.size() != b.size() || out.size() < a.size()) {
+        throw std::invalid_argument("Batch inputs must have equal length and fit in the output");
+    }
+    if (!errors.empty() && errors.size() < a.size()) {
+        throw std::invalid_argument("Error output must have one entry per element");
+    }
+
+    std::uint64_t inputMask[batch::kValidationBlock / 64];
+    std::uint64_t resultMask[batch::kValidationBlock / 64];
+    std::size_t failures = 0;
+    for (std::size_t start = 0; start < a.size(); start += batch::kValidationBlock) {
+        std::size_t length = std::min(batch::kValidationBlock, a.size() - start);
+        std::size_t words = (length + 63) / 64;
+        auto blockA = a.subspan(start, length);
+        auto blockB = b.subspan(start, length);
+        auto blockOut = out.subspan(start, length);
+
+        std::size_t marked = batch::validate<batch::Check::FiniteNonZeroDivisor>(blockA, blockB, inputMask);
+        batch::run<batch::Op::Divide>(blockA, blockB, blockOut);
+        // Valid inputs can still overflow, e.g. 1e308 / 1e-308; the quotients get the same scan
+        std::span<const double> quotients(blockOut.data(), length);
+        marked += batch::validate<batch::Check::Finite>(quotients, quotients, resultMask);
+        if (!errors.empty()) {
+            std::fill_n(errors.begin() + static_cast<std::ptrdiff_t>(start), length, CalcError::None);
+        }
+        if (marked == 0) {
+            continue;
+        }
+
+        for (std::size_t word = 0; word < words; ++word) {
+            inputMask[word] |= resultMask[word];
+        }
+        // tryDivide on just these lanes decides which error each one has
+        batch::forEachMarked(std::span<const std::uint64_t>(inputMask, words), [&](std::size_t lane) {
+            CalcResult result = tryDivide(blockA[lane], blockB[lane]);
+            blockOut[lane] = std::numeric_limits<double>::quiet_NaN();
+            if (!errors.empty()) {
+                errors[start + lane] = result.error;
+            }
+            failures++;
+        });
+    }
+    return failures;
+}
+
+// Per-pair tryAdd/tryDivide against the batch versions, on clean input and
+// with 1% bad values, plus the raw validator throughput per instruction set
+void benchmarkBatchValidation() {
+    using Clock = std::chrono::steady_clock;
+    constexpr std::size_t kElements = 1 << 20;
+    constexpr int kRepeats = 20;
+
+    auto nanosPerElement = [](Clock::time_point start) {
+        return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / (kElements * kRepeats);
+    };
+
+    std::vector<double> a(kElements), b(kElements), out(kElements);
+    std::vector<CalcError> errors(kElements);
+    std::vector<std::uint64_t> mask((kElements + 63) / 64);
+    SafeCalculator calc;
+
+    std::cout << std::fixed << std::setprecision(2);
+    for (double badRate : {0.0, 0.01}) {
+        std::mt19937_64 random(7);
+        std::uniform_real_distribution<double> value(-1e6, 1e6);
+        std::bernoulli_distribution isBad(badRate);
+        for (std::size_t i = 0; i < kElements; ++i) {
+            a[i] = value(random);
+            b[i] = value(random);
+            if (isBad(random)) {
+                a[i] = i % 2 ? std::numeric_limits<double>::quiet_NaN() : std::numeric_limits<double>::infinity();
+            }
+        }
+
+        std::cout << "\n" << badRate * 100 << "% bad inputs (ns/element)" << std::endl;
+        auto start = Clock::now();
+        for (int r = 0; r < kRepeats; ++r) {
+            for (std::size_t i = 0; i < kElements; ++i) {
+                CalcResult result = calc.tryAdd(a[i], b[i]);
+                out[i] = result.value;
+                errors[i] = result.error;
+            }
+        }
+        std::cout << "tryAdd per pair:    " << nanosPerElement(start) << std::endl;
+
+        start = Clock::now();
+        for (int r = 0; r < kRepeats; ++r) {
+            calc.tryAddBatch(a, b, out, errors);
+        }
+        std::cout << "tryAddBatch:        " << nanosPerElement(start) << std::endl;
+
+        start = Clock::now();
+        for (int r = 0; r < kRepeats; ++r) {
+            for (std::size_t i = 0; i < kElements; ++i) {
+                CalcResult result = calc.tryDivide(a[i], b[i]);
+                out[i] = result.value;
+                errors[i] = result.error;
+            }
+        }
+        std::cout << "tryDivide per pair: " << nanosPerElement(start) << std::endl;
+
+        start = Clock::now();
+        for (int r = 0; r < kRepeats; ++r) {
+            calc.tryDivideBatch(a, b, out, errors);
+        }
+        std::cout << "tryDivideBatch:     " << nanosPerElement(start) << std::endl;
+    }
+
+    std::cout << "\nvalidator alone (GB/s of input)" << std::endl;
+    for (batch::Isa isa : {batch::Isa::Scalar, batch::Isa::Avx2, batch::Isa::Avx512}) {
+        if (isa != batch::Isa::Scalar && static_cast<int>(isa) > static_cast<int>(batch::activeIsa())) {
+            continue;
+        }
+        batch::ValidateKernel kernel = batch::validatorFor<batch::Check::Finite>(isa);
+        auto start = Clock::now();
+        for (int r = 0; r < kRepeats; ++r) {
+            kernel(a.data(), b.data(), mask.data(), kElements);
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        std::cout << std::left << std::setw(8) << batch::isaName(isa) << std::right
+                  << std::setw(8) << 2.0 * sizeof(double) * kElements * kRepeats / seconds / 1e9 << std::endl;
     }
 }
 